@@ -0,0 +1,183 @@
+#!/usr/bin/env bash
+# end to end launcher benchmark. builds fixture repositories on local disk and times whole
+# launcher runs (setup_repository, setup_wcmake, build_wcmake, launch), so it never needs network.
+# run from the msys2 shell with git, cmake, ninja and gcc installed.
+#
+# usage: bench/bench-e2e.sh <launcher> [--save-baseline]
+#   BENCH_RUNS   runs per scenario (default 5)
+#   BENCH_FILES  source files in the synthetic project (default 200)
+#   BENCH_DIR    scratch directory (default out/bench-e2e)
+set -euo pipefail
+
+launcher=$(realpath "$1")
+save_baseline=${2:-}
+runs=${BENCH_RUNS:-5}
+files=${BENCH_FILES:-200}
+work=${BENCH_DIR:-out/bench-e2e}
+baseline=$(dirname "$0")/baseline.txt
+
+export GIT_AUTHOR_NAME=bench GIT_AUTHOR_EMAIL=bench@localhost
+export GIT_COMMITTER_NAME=bench GIT_COMMITTER_EMAIL=bench@localhost
+# submodules are cloned from local paths, which newer git refuses by default
+export GIT_CONFIG_COUNT=1 GIT_CONFIG_KEY_0=protocol.file.allow GIT_CONFIG_VALUE_0=always
+
+# launch.json wants windows paths, forward slashes keep them json safe
+winpath() {
+    if command -v cygpath > /dev/null; then cygpath -m "$1"; else echo "$1"; fi
+}
+now_ms() {
+    echo $(( $(date +%s%N) / 1000000 ))
+}
+
+make_fixture() {
+    rm -rf "$work"
+    mkdir -p "$work/src" "$work/remote" "$work/run" "$work/results"
+    work=$(realpath "$work")
+
+    git init -q -b main "$work/src/lib"
+    echo 'add_library(lib STATIC lib.c)' > "$work/src/lib/CMakeLists.txt"
+    echo 'int lib_value(void) { return 1; }' > "$work/src/lib/lib.c"
+    git -C "$work/src/lib" add -A
+    git -C "$work/src/lib" commit -q -m "lib"
+    git clone -q --bare "$work/src/lib" "$work/remote/lib.git"
+
+    local app="$work/src/app"
+    git init -q -b main "$app"
+    mkdir "$app/src"
+    cat > "$app/CMakeLists.txt" <<CMAKE
+cmake_minimum_required(VERSION 3.10)
+project(app C)
+add_subdirectory(lib)
+file(GLOB SOURCES src/*.c)
+add_executable(app \${SOURCES})
+target_link_libraries(app lib)
+CMAKE
+    {
+        echo '#include <stdio.h>'
+        echo 'int lib_value(void);'
+        for i in $(seq "$files"); do echo "int f$i(void);"; done
+        echo 'int main(void) {'
+        echo '    int sum = lib_value();'
+        for i in $(seq "$files"); do echo "    sum += f$i();"; done
+        echo '    printf("%d\n", sum);'
+        echo '    return 0;'
+        echo '}'
+    } > "$app/src/main.c"
+    for i in $(seq "$files"); do
+        echo "int f$i(void) { return $i; }" > "$app/src/f$i.c"
+    done
+    git -C "$app" submodule -q add "$work/remote/lib.git" lib
+    git -C "$app" add -A
+    git -C "$app" commit -q -m "app"
+    git -C "$app" branch feature
+    git clone -q --bare "$app" "$work/remote/app.git"
+
+    # upstream changes are pushed from here
+    git clone -q "$work/remote/app.git" "$work/upstream"
+}
+
+write_launch_json() { # branch [update interval]
+    {
+        echo '{'
+        echo "    \"repo\": \"$work/remote/app.git\","
+        echo "    \"branch\": \"$1\","
+        echo '    "executable": "build\\app.exe",'
+        echo "    \"msys path\": \"$(winpath /)\","
+        echo "    \"store path\": \"$(winpath "$work/store")\"${2:+,}"
+        if [ -n "${2:-}" ]; then echo "    \"update interval\": $2"; fi
+        echo '}'
+    } > "$work/run/launch.json"
+}
+
+push_change() { # file to append a comment to
+    case "$1" in
+        *.c) echo "/* $(date +%s%N) */" >> "$work/upstream/$1" ;;
+        *)   echo "# $(date +%s%N)" >> "$work/upstream/$1" ;;
+    esac
+    git -C "$work/upstream" commit -q -am "change $1"
+    git -C "$work/upstream" push -q origin main
+}
+
+measure() { # scenario
+    local start log="$work/results/$1.log"
+    start=$(now_ms)
+    if ! (cd "$work/run" && "$launcher" < /dev/null >> "$log" 2>&1); then
+        echo "$1: launcher failed, see $log" >&2
+        exit 1
+    fi
+    echo $(( $(now_ms) - start )) >> "$work/results/$1"
+}
+
+# median, p90, min and max of a file with one number per line
+stats() {
+    sort -n "$1" | awk '{ v[NR] = $1 } END {
+        median = NR % 2 ? v[(NR + 1) / 2] : (v[NR / 2] + v[NR / 2 + 1]) / 2
+        p90 = v[int(NR * 0.9 + 0.999)]
+        print median, p90, v[1], v[NR]
+    }'
+}
+
+echo "building fixture ($files files) in $work..."
+make_fixture
+
+for i in $(seq "$runs"); do
+    rm -rf "$work/store" "$work/run/launcher"
+    write_launch_json main
+    measure cold-clone
+done
+
+for i in $(seq "$runs"); do
+    measure warm-noop
+done
+
+write_launch_json main 60
+measure warm-fast-path # first run is a full run and writes the state
+: > "$work/results/warm-fast-path"
+for i in $(seq "$runs"); do
+    measure warm-fast-path
+done
+
+write_launch_json main
+for i in $(seq "$runs"); do
+    push_change src/f1.c
+    measure one-file-changed
+done
+
+for i in $(seq "$runs"); do
+    push_change CMakeLists.txt
+    measure cmakelists-changed
+done
+
+# both worktrees exist after the warm up, so this times switching rather than setting up a branch
+for branch in feature main; do
+    write_launch_json $branch
+    measure branch-switch
+done
+: > "$work/results/branch-switch"
+for i in $(seq "$runs"); do
+    if [ $((i % 2)) -eq 1 ]; then write_launch_json feature; else write_launch_json main; fi
+    measure branch-switch
+done
+
+scenarios="cold-clone warm-noop warm-fast-path one-file-changed cmakelists-changed branch-switch"
+printf "\n%-20s %10s %10s %10s %10s %10s\n" scenario "median ms" "p90 ms" "min ms" "max ms" baseline
+for scenario in $scenarios; do
+    read -r median p90 min max <<< "$(stats "$work/results/$scenario")"
+    base=$(awk -v s="$scenario" '$1 == s { print $2 }' "$baseline" 2> /dev/null || true)
+    if [ -n "$base" ] && [ "$base" != 0 ]; then
+        delta=$(awk -v m="$median" -v b="$base" 'BEGIN { printf "%+.1f%%", (m - b) * 100 / b }')
+    else
+        delta="-"
+    fi
+    printf "%-20s %10s %10s %10s %10s %10s\n" "$scenario" "$median" "$p90" "$min" "$max" "$delta"
+done
+
+if [ "$save_baseline" = "--save-baseline" ]; then
+    for scenario in $scenarios; do
+        read -r median p90 min max <<< "$(stats "$work/results/$scenario")"
+        echo "$scenario $median $p90"
+    done > "$baseline"
+    echo "saved baseline to $baseline"
+elif [ ! -f "$baseline" ]; then
+    echo "no baseline yet, save one with make bench-e2e-baseline"
+fi
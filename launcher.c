@@ -6,14 +6,39 @@
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <time.h>
 #include "nxjson.h"
 
+#define HASH_SEED 14695981039346656037ULL
+#define WATCH_DEBOUNCE_MS 300 // quiet period that ends a burst of changes
+#define WATCH_STAMP_MS (60 * 60 * 1000) // how often an idle watch marks its worktree as used
+#define COMMAND_SIZE 8192      // git commands repeat store and worktree paths several times
+
 // buffers
 char cuwd[1024];
 char unix_path[1024];
 char windows_path[1024];
 
 char msys_dir[1024];
+char launcher_dir[1024];
+char store_dir[1024];      // shared by every launcher directory using the same repo url
+char repository_dir[1024]; // worktree of the configured branch, or launcher/repository for old clones
+
+HANDLE build_job;      // configure and build process trees, see create_job
+HANDLE executable_job; // the launched executable and its children
+DWORD build_priority;      // priority class creation flag, see read_priority_class
+DWORD executable_priority;
+
+// everything a warm launch has to verify before skipping straight to the executable.
+// saved to state.json in the launcher directory after every successful full run
+struct launcher_state {
+    unsigned long long config;    // launch file contents
+    unsigned long long packages;  // installed package list
+    char ref[64];                 // commit checked out in the repository
+    unsigned long long configure; // CMakeLists.txt and CMakeCache.txt stamps
+    unsigned long long build;     // executable stamp for that commit
+    long long checked;            // last upstream check, seconds since epoch
+};
 
 char *convert_to_unix_path(const char *windows_path) {
     if (windows_path[1] == ':') {
@@ -35,6 +60,26 @@ char *convert_to_unix_path(const char *windows_path) {
 
     return unix_path;
 }
+// reverse of convert_to_unix_path, for paths written by msys git
+char *convert_to_windows_path(const char *path) {
+    if(path[0] == '/' && isalpha(path[1]) && (path[2] == '/' || path[2] == '\0')) {
+        // Convert "/c/path" to "C:/path"
+        snprintf(windows_path, sizeof(windows_path), "%c:%s", toupper(path[1]), &path[2]);
+    } else if(path[0] == '/') {
+        // msys root relative
+        snprintf(windows_path, sizeof(windows_path), "%s%s", msys_dir, path);
+    } else {
+        snprintf(windows_path, sizeof(windows_path), "%s", path);
+    }
+
+    for (int i = 0; windows_path[i] != '\0'; i++) {
+        if (windows_path[i] == '/') {
+            windows_path[i] = '\\';
+        }
+    }
+
+    return windows_path;
+}
 char *cwd() {
     getcwd(cuwd, sizeof(cuwd));
     return cuwd;
@@ -56,11 +101,60 @@ int exists(const char *name) {
   struct stat buffer;
   return stat(name, &buffer) == 0;
 }
+double elapsed_ms(LARGE_INTEGER since) {
+    LARGE_INTEGER now, frequency;
+    QueryPerformanceCounter(&now);
+    QueryPerformanceFrequency(&frequency);
+    return (now.QuadPart - since.QuadPart) * 1000.0 / frequency.QuadPart;
+}
+// starts a program directly instead of through cmd.exe. 
+// with a job, it is added before it runs, so everything it starts ends up in the job too
+int spawn(const char *name, PROCESS_INFORMATION *process, DWORD flags, HANDLE job) {
+    char command[COMMAND_SIZE];
+    if(snprintf(command, sizeof(command), "%s", name) >= sizeof(command)) {
+        fprintf(stderr, "command too long: %s\n", name);
+        return 0;
+    }
+    STARTUPINFO startup_info = { sizeof(startup_info) };
+    if(!CreateProcess(NULL, command, NULL, NULL, FALSE, flags | (job ? CREATE_SUSPENDED : 0), NULL, NULL, &startup_info, process)) {
+        fprintf(stderr, "failed to launch %s (error %lu)\n", name, GetLastError());
+        return 0;
+    }
+    if(job) {
+        if(!AssignProcessToJobObject(job, process->hProcess)) {
+            fprintf(stderr, "failed to apply affinity and cpu limit to %s (error %lu)\n", name, GetLastError());
+        }
+        ResumeThread(process->hThread);
+    }
+    return 1;
+}
+// fails instead of running a cut off command
+int msys_command(char *command, size_t size, const char *cmd) {
+    if(snprintf(command, size, "%s/usr/bin/bash.exe -lc \"export PATH=/mingw64/bin:$PATH; cd '%s'; %s\"", msys_dir, ucwd(), cmd) >= size) {
+        fprintf(stderr, "command too long: %s\n", cmd);
+        return 0;
+    }
+    return 1;
+}
 int msys(const char *cmd) {
-    char command[1024];
-    snprintf(command, sizeof(command), "%s/usr/bin/bash.exe -lc \"export PATH=/mingw64/bin:$PATH; cd %s; %s\"", msys_dir, ucwd(), cmd);
+    char command[COMMAND_SIZE];
+    if(!msys_command(command, sizeof(command), cmd)) return -1;
     return system(command);
 }
+// like msys, but runs the whole process tree inside job at priority_class
+int msys_in_job(const char *cmd, HANDLE job, DWORD priority_class) {
+    if(job == NULL && priority_class == 0) return msys(cmd);
+    char command[COMMAND_SIZE];
+    if(!msys_command(command, sizeof(command), cmd)) return -1;
+    PROCESS_INFORMATION process;
+    if(!spawn(command, &process, priority_class, job)) return -1;
+    WaitForSingleObject(process.hProcess, INFINITE);
+    DWORD exit_code = EXIT_FAILURE;
+    GetExitCodeProcess(process.hProcess, &exit_code);
+    CloseHandle(process.hThread);
+    CloseHandle(process.hProcess);
+    return exit_code;
+}
 char *read_file_as_null_terminated_string(const char *file_path) {
     FILE *file = fopen(file_path, "rb");  // Open the file in binary mode
     if (file == NULL) {
@@ -96,6 +190,213 @@ char *read_file_as_null_terminated_string(const char *file_path) {
     fclose(file);  // Close the file
     return buffer;  // Return the buffer containing the null-terminated string
 }
+// fnv-1a
+unsigned long long hash_bytes(unsigned long long hash, const void *data, size_t size) {
+    const unsigned char *bytes = data;
+    for(size_t i = 0; i < size; ++i) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+unsigned long long hash_string(unsigned long long hash, const char *string) {
+    return hash_bytes(hash, string, strlen(string) + 1);
+}
+// hashes modification time and size, so a missing file hashes differently from an empty one
+unsigned long long hash_file_stamp(unsigned long long hash, const char *filename) {
+    struct stat attr;
+    long long stamp[2] = {0, -1};
+    if(stat(filename, &attr) == 0) {
+        stamp[0] = attr.st_mtime;
+        stamp[1] = attr.st_size;
+    }
+    return hash_bytes(hash, stamp, sizeof(stamp));
+}
+// package list plus the state of the msys install itself: pacman's local database directory
+// gets a new entry for every package installed, upgraded or removed
+unsigned long long hash_packages(nx_json const *packages, nx_json const *custom_commands) {
+    char path[1024];
+    unsigned long long hash = hash_file_stamp(HASH_SEED, msys_dir);
+    snprintf(path, sizeof(path), "%s\\var\\lib\\pacman\\local", msys_dir);
+    hash = hash_file_stamp(hash, path);
+    if(packages) {
+        for(int i = 0; i < packages->children.length; ++i) {
+            hash = hash_string(hash, nx_json_item(packages, i)->text_value);
+        }
+    }
+    return hash_string(hash, custom_commands ? "custom" : "cmake");
+}
+// reads the first line of a small file
+int read_line(const char *filename, char *line, size_t size) {
+    if(!exists(filename)) return 0;
+    char *buffer = read_file_as_null_terminated_string(filename);
+    if(!buffer) return 0;
+    buffer[strcspn(buffer, "\r\n")] = '\0';
+    snprintf(line, size, "%s", buffer);
+    free(buffer);
+    return 1;
+}
+// resolves HEAD of a clone or worktree by reading git's files directly, without spawning git
+int read_head_ref(const char *repository, char *ref, size_t size) {
+    char git_dir[1024], common_dir[1024], head[1024], path[1024];
+    struct stat attr;
+    snprintf(git_dir, sizeof(git_dir), "%s/.git", repository);
+    if(stat(git_dir, &attr) != 0) return 0;
+    if(!S_ISDIR(attr.st_mode)) { // worktree, .git points at its admin directory in the shared store
+        if(!read_line(git_dir, head, sizeof(head)) || strncmp(head, "gitdir: ", 8) != 0) return 0;
+        snprintf(git_dir, sizeof(git_dir), "%s", convert_to_windows_path(head + 8));
+    }
+    // branches live in the common directory, HEAD is per worktree
+    snprintf(common_dir, sizeof(common_dir), "%s", git_dir);
+    snprintf(path, sizeof(path), "%s/commondir", git_dir);
+    if(read_line(path, head, sizeof(head))) {
+        if(head[0] == '/' || head[1] == ':') {
+            snprintf(common_dir, sizeof(common_dir), "%s", convert_to_windows_path(head));
+        } else {
+            snprintf(common_dir, sizeof(common_dir), "%s/%s", git_dir, head);
+        }
+    }
+
+    snprintf(path, sizeof(path), "%s/HEAD", git_dir);
+    if(!read_line(path, head, sizeof(head))) return 0;
+    ref[0] = '\0';
+
+    if(strncmp(head, "ref: ", 5) != 0) { // detached head
+        snprintf(ref, size, "%s", head);
+    } else {
+        snprintf(path, sizeof(path), "%s/%s", common_dir, head + 5);
+        if(!read_line(path, ref, size)) { // ref was packed by gc
+            snprintf(path, sizeof(path), "%s/packed-refs", common_dir);
+            char *packed = exists(path) ? read_file_as_null_terminated_string(path) : NULL;
+            for(char *line = packed ? strtok(packed, "\r\n") : NULL; line; line = strtok(NULL, "\r\n")) {
+                char *name = strchr(line, ' ');
+                if(line[0] == '#' || line[0] == '^' || !name) continue;
+                if(strcmp(name + 1, head + 5) == 0) {
+                    *name = '\0';
+                    snprintf(ref, size, "%s", line);
+                    break;
+                }
+            }
+            free(packed);
+        }
+    }
+    return ref[0] != '\0';
+}
+// compares paths up to a separator, treating \ and / the same
+int path_starts_with(const char *path, const char *prefix) {
+    for(; *prefix; ++path, ++prefix) {
+        int a = *path == '\\' ? '/' : tolower(*path);
+        int b = *prefix == '\\' ? '/' : tolower(*prefix);
+        if(a != b) return 0;
+    }
+    return *path == '\0' || *path == '\\' || *path == '/';
+}
+int is_ignored(const char *path, nx_json const *ignore) {
+    if(path_starts_with(path, "build") || path_starts_with(path, ".git")) return 1;
+    for(int i = 0; ignore && i < ignore->children.length; ++i) {
+        if(path_starts_with(path, nx_json_item(ignore, i)->text_value)) return 1;
+    }
+    return 0;
+}
+// newest modification time in the repository outside the ignored paths, relative is the
+// subdirectory to start from. cheap enough for the fast path, it only stats
+time_t newest_source_time(const char *relative, nx_json const *ignore) {
+    char path[1024];
+    snprintf(path, sizeof(path), "%s\\%s", repository_dir, relative);
+    DIR *dir = opendir(path);
+    if(dir == NULL) return 0;
+
+    time_t newest = 0;
+    struct dirent *entry;
+    while((entry = readdir(dir)) != NULL) {
+        if(strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) continue;
+        char child[1024];
+        snprintf(child, sizeof(child), relative[0] ? "%s\\%s" : "%s%s", relative, entry->d_name);
+        if(is_ignored(child, ignore)) continue;
+
+        struct stat attr;
+        snprintf(path, sizeof(path), "%s\\%s", repository_dir, child);
+        if(stat(path, &attr) != 0) continue;
+        time_t modified = attr.st_mtime; // a directory's own time covers deleted files
+        if(S_ISDIR(attr.st_mode)) {
+            time_t inside = newest_source_time(child, ignore);
+            if(inside > modified) modified = inside;
+        }
+        if(modified > newest) newest = modified;
+    }
+    closedir(dir);
+    return newest;
+}
+// fills ref and fingerprints from the repository on disk. fails if there is nothing to launch
+int compute_state(struct launcher_state *state, const char *executable, nx_json const *ignore) {
+    char path[1024];
+    if(!read_head_ref(repository_dir, state->ref, sizeof(state->ref))) return 0;
+
+    snprintf(path, sizeof(path), "%s/CMakeLists.txt", repository_dir);
+    state->configure = hash_file_stamp(HASH_SEED, path);
+    snprintf(path, sizeof(path), "%s/build/CMakeCache.txt", repository_dir);
+    state->configure = hash_file_stamp(state->configure, path);
+
+    snprintf(path, sizeof(path), "%s/%s", repository_dir, executable);
+    if(!exists(path)) return 0;
+    state->build = hash_file_stamp(hash_string(HASH_SEED, state->ref), path);
+    // edits in the checkout since the build, so they don't launch a stale executable
+    time_t sources = newest_source_time("", ignore);
+    state->build = hash_bytes(state->build, &sources, sizeof(sources));
+    return 1;
+}
+int load_state(struct launcher_state *state) {
+    char path[1024];
+    snprintf(path, sizeof(path), "%s/state.json", launcher_dir);
+    if(!exists(path)) return 0;
+    char *buffer = read_file_as_null_terminated_string(path);
+    if(!buffer) return 0;
+    nx_json const *json = nx_json_parse_utf8(buffer);
+    int ok = 0;
+    if(json) {
+        nx_json const *config    = nx_json_get(json, "config");
+        nx_json const *packages  = nx_json_get(json, "packages");
+        nx_json const *ref       = nx_json_get(json, "ref");
+        nx_json const *configure = nx_json_get(json, "configure");
+        nx_json const *build     = nx_json_get(json, "build");
+        nx_json const *checked   = nx_json_get(json, "checked");
+        ok = config && packages && ref && configure && build && checked;
+        if(ok) {
+            state->config    = strtoull(config->text_value, NULL, 16);
+            state->packages  = strtoull(packages->text_value, NULL, 16);
+            snprintf(state->ref, sizeof(state->ref), "%s", ref->text_value);
+            state->configure = strtoull(configure->text_value, NULL, 16);
+            state->build     = strtoull(build->text_value, NULL, 16);
+            state->checked   = (long long) checked->num.s_value;
+        }
+        nx_json_free(json);
+    }
+    free(buffer);
+    return ok;
+}
+int save_state(const struct launcher_state *state) {
+    char path[1024];
+    snprintf(path, sizeof(path), "%s/state.json", launcher_dir);
+    FILE *file = fopen(path, "wb");
+    if(file == NULL) {
+        perror("Error writing state");
+        return 0;
+    }
+    fprintf(file, "{\n");
+    fprintf(file, "    \"config\": \"%016llx\",\n", state->config);
+    fprintf(file, "    \"packages\": \"%016llx\",\n", state->packages);
+    fprintf(file, "    \"ref\": \"%s\",\n", state->ref);
+    fprintf(file, "    \"configure\": \"%016llx\",\n", state->configure);
+    fprintf(file, "    \"build\": \"%016llx\",\n", state->build);
+    fprintf(file, "    \"checked\": %lld\n", state->checked);
+    fprintf(file, "}\n");
+    return fclose(file) == 0;
+}
+void invalidate_state() {
+    char path[1024];
+    snprintf(path, sizeof(path), "%s/state.json", launcher_dir);
+    remove(path);
+}
 int is_package_installed(const char *package) {
     char command[256];
     snprintf(command, sizeof(command), 
@@ -134,7 +435,38 @@ void add_to_path(const char *var) {
     SetEnvironmentVariable("PATH", newPath);
 }
 
-int setup_repository(const char *url, const char *branch) {
+// picks the shared store for the repo url and the worktree for the branch inside it:
+// <store root>\<name>-<url hash>\repository.git and <store root>\<name>-<url hash>\worktrees\<branch>
+void locate_repository(const char *store_root, const char *url, const char *branch) {
+    char name[256];
+    const char *base = url;
+    for(const char *c = url; *c; ++c) {
+        if((*c == '/' || *c == '\\' || *c == ':') && c[1] != '\0') base = c + 1;
+    }
+    snprintf(name, sizeof(name), "%s", base);
+    name[strcspn(name, "/")] = '\0';
+    size_t length = strlen(name);
+    if(length > 4 && strcmp(name + length - 4, ".git") == 0) name[length - 4] = '\0';
+    snprintf(store_dir, sizeof(store_dir), "%s\\%s-%08llx", store_root, name, hash_string(HASH_SEED, url) & 0xffffffffULL);
+
+    snprintf(name, sizeof(name), "%s", branch);
+    for(int i = 0; name[i] != '\0'; i++) {
+        if(name[i] == '/' || name[i] == '\\' || name[i] == ':') name[i] = '-';
+    }
+    snprintf(repository_dir, sizeof(repository_dir), "%s\\worktrees\\%s", store_dir, name);
+}
+// marks the worktree as used for prune_worktrees. no-op for old clones, which have no store
+void touch_worktree_stamp() {
+    if(store_dir[0] == '\0') return;
+    char path[1024];
+    snprintf(path, sizeof(path), "%s\\used", store_dir);
+    mkdir(path);
+    snprintf(path, sizeof(path), "%s\\used\\%s", store_dir, strrchr(repository_dir, '\\') + 1);
+    FILE *stamp = fopen(path, "wb");
+    if(stamp) fclose(stamp);
+}
+// clone made by older launchers in launcher\repository, kept as is
+int setup_clone(const char *url, const char *branch) {
     int ok;
     if(exists("repository")) { // directory exists, already cloned
         chdir("repository");
@@ -150,36 +482,301 @@ int setup_repository(const char *url, const char *branch) {
     }
     return ok;
 }
+// keeps one bare clone per repo url and checks the branch out as a worktree of it,
+// so branches share objects and a fetch for one of them is a fetch for all
+int setup_repository(const char *url, const char *branch) {
+    char store[1024], command[COMMAND_SIZE];
+    snprintf(store, sizeof(store), "%s/repository.git", convert_to_unix_path(store_dir));
+    int ok = 1;
+
+    snprintf(command, sizeof(command), "%s\\repository.git", store_dir);
+    if(!exists(command)) {
+        printf("cloning %s...\n", url);
+        ok = snprintf(command, sizeof(command), "git clone --bare %s '%s' && git -C '%s' config remote.origin.fetch '+refs/heads/*:refs/remotes/origin/*'", url, store, store) < sizeof(command);
+        ok = ok && msys(command) == 0;
+    }
+    if(ok && exists(repository_dir)) {
+        chdir(repository_dir);
+        ok = msys("git pull -j 4 --autostash") == 0;
+        ok = msys("git submodule update --remote --recursive -j 4") == 0 && ok;
+    } else if(ok) {
+        printf("adding worktree for %s...\n", branch);
+        ok = snprintf(command, sizeof(command), "git -C '%s' fetch -j 4 --prune origin && git -C '%s' worktree prune && git -C '%s' worktree add --force --track -B %s '%s' origin/%s", 
+            store, store, store, branch, convert_to_unix_path(repository_dir), branch) < sizeof(command);
+        ok = ok && msys(command) == 0 && chdir(repository_dir) == 0;
+
+        // submodules of a worktree get their own repositories, so clone each one from a copy another
+        // worktree already has. --dissociate copies the objects, pruning that worktree can't break this one
+        snprintf(command, sizeof(command), "IFS=$'\\n'; git config -f .gitmodules --null --get-regexp '^submodule[.].*[.]path$' | while read -r -d '' key path; do "
+            "name=${key#submodule.}; name=${name::-5}; reference=$(ls -d '%s'/worktrees/*/modules/$name 2>/dev/null | head -n 1); "
+            "git submodule update --init ${reference:+--reference=$reference} ${reference:+--dissociate} -- $path || exit 1; "
+            "done && git submodule update --init --recursive -j 4", store);
+        ok = ok && msys(command) == 0;
+    }
+
+    touch_worktree_stamp();
+    return ok;
+}
+// removes worktrees of the store, other than the current one, that no launcher used for the given number of days
+void prune_worktrees(double days) {
+    if(days <= 0) {
+        fprintf(stderr, "prune worktrees must be a positive number of days\n");
+        return;
+    }
+    char path[1024], store[1024], worktree[1024], command[COMMAND_SIZE];
+    const char *current = strrchr(repository_dir, '\\') + 1;
+    snprintf(store, sizeof(store), "%s/repository.git", convert_to_unix_path(store_dir));
+    snprintf(path, sizeof(path), "%s\\used", store_dir);
+    DIR *dir = opendir(path);
+    if(dir == NULL) return;
+
+    struct dirent *entry;
+    while((entry = readdir(dir)) != NULL) {
+        struct stat attr;
+        if(strcmp(entry->d_name, current) == 0) continue;
+        snprintf(path, sizeof(path), "%s\\used\\%s", store_dir, entry->d_name);
+        if(stat(path, &attr) != 0 || !S_ISREG(attr.st_mode) || time(NULL) - attr.st_mtime < days * 24 * 60 * 60) continue;
+
+        printf("removing unused worktree %s...\n", entry->d_name);
+        snprintf(worktree, sizeof(worktree), "%s\\worktrees\\%s", store_dir, entry->d_name);
+        snprintf(command, sizeof(command), "git -C '%s' worktree remove --force '%s' && git -C '%s' worktree prune", 
+            store, convert_to_unix_path(worktree), store); // three paths of at most 1024 each, always fits
+        // a locked file keeps the worktree around, keep its stamp so the next run tries again
+        if(msys(command) == 0 && !exists(worktree)) {
+            remove(path);
+        }
+    }
+    closedir(dir);
+}
+DWORD parse_priority_class(const char *name) {
+    if(strcmp(name, "idle") == 0)         return IDLE_PRIORITY_CLASS;
+    if(strcmp(name, "below normal") == 0) return BELOW_NORMAL_PRIORITY_CLASS;
+    if(strcmp(name, "normal") == 0)       return NORMAL_PRIORITY_CLASS;
+    if(strcmp(name, "above normal") == 0) return ABOVE_NORMAL_PRIORITY_CLASS;
+    if(strcmp(name, "high") == 0)         return HIGH_PRIORITY_CLASS;
+    fprintf(stderr, "unknown priority %s, expected idle, below normal, normal, above normal or high\n", name);
+    return 0;
+}
+// "<prefix> priority" as a creation flag for spawn, 0 if not configured.
+// not set on the job: that needs SE_INC_BASE_PRIORITY_NAME, which normal accounts don't have enabled.
+// children inherit idle and below normal from the process they are started by
+DWORD read_priority_class(nx_json const *json, const char *prefix) {
+    char key[64];
+    snprintf(key, sizeof(key), "%s priority", prefix);
+    nx_json const *priority = nx_json_get(json, key);
+    return priority ? parse_priority_class(priority->text_value) : 0;
+}
+// job object that pins a process tree to "<prefix> affinity" (cpu mask)
+// and "<prefix> cpu limit" (percent of all cpus). NULL if neither is configured
+HANDLE create_job(nx_json const *json, const char *prefix) {
+    char key[64];
+    snprintf(key, sizeof(key), "%s affinity", prefix);
+    nx_json const *affinity = nx_json_get(json, key);
+    snprintf(key, sizeof(key), "%s cpu limit", prefix);
+    nx_json const *cpu_limit = nx_json_get(json, key);
+    if(!affinity && !cpu_limit) return NULL;
+
+    HANDLE job = CreateJobObject(NULL, NULL);
+    if(job == NULL) {
+        fprintf(stderr, "failed to create %s job (error %lu)\n", prefix, GetLastError());
+        return NULL;
+    }
+    if(affinity) { // "0xf0" strings for readable masks
+        JOBOBJECT_BASIC_LIMIT_INFORMATION limits = {0};
+        limits.Affinity = affinity->type == NX_JSON_STRING ? strtoull(affinity->text_value, NULL, 0) : affinity->num.u_value;
+        limits.LimitFlags = JOB_OBJECT_LIMIT_AFFINITY;
+        if(!SetInformationJobObject(job, JobObjectBasicLimitInformation, &limits, sizeof(limits))) {
+            fprintf(stderr, "failed to set %s affinity (error %lu)\n", prefix, GetLastError());
+        }
+    }
+    if(cpu_limit) {
+        JOBOBJECT_CPU_RATE_CONTROL_INFORMATION rate = {0};
+        rate.ControlFlags = JOB_OBJECT_CPU_RATE_CONTROL_ENABLE | JOB_OBJECT_CPU_RATE_CONTROL_HARD_CAP;
+        rate.CpuRate = (DWORD) (cpu_limit->num.dbl_value * 100); // in 1/100 of a percent
+        if(!SetInformationJobObject(job, JobObjectCpuRateControlInformation, &rate, sizeof(rate))) {
+            fprintf(stderr, "failed to set %s cpu limit (error %lu)\n", prefix, GetLastError());
+        }
+    }
+    return job;
+}
 int setup_wcmake() {
     int ok = 1;
     if(exists("build")) {
         if(get_modification_time("CMakeLists.txt") > get_modification_time("build/CMakeCache.txt")) 
         { // needs to be reconfigured
             system("rmdir /s /q \"build\"");
-            ok = ok && msys("cmake -S . -B build -D CMAKE_BUILD_TYPE=RELEASE") == 0;
+            ok = ok && msys_in_job("cmake -S . -B build -D CMAKE_BUILD_TYPE=RELEASE", build_job, build_priority) == 0;
         }
     } else if(ENOENT == errno) {
-        ok = ok && msys("cmake -S . -B build -D CMAKE_BUILD_TYPE=RELEASE") == 0;
+        ok = ok && msys_in_job("cmake -S . -B build -D CMAKE_BUILD_TYPE=RELEASE", build_job, build_priority) == 0;
     }
     return ok;
 }
 int build_wcmake() {
-    return msys("cmake --build build") == 0;
+    return msys_in_job("cmake --build build", build_job, build_priority) == 0;
+}
+int run_custom_commands(nx_json const *custom_commands) {
+    int ok = 1;
+    for(int i = 0; i < custom_commands->children.length; ++i) {
+        ok = msys_in_job(nx_json_item(custom_commands, i)->text_value, build_job, build_priority) == 0 && ok;
+    }
+    return ok;
 }
 int launch(const char *name) {
-    return system(name) == 0;
+    PROCESS_INFORMATION process;
+    if(!spawn(name, &process, executable_priority, executable_job)) return 0;
+    WaitForSingleObject(process.hProcess, INFINITE);
+    DWORD exit_code = EXIT_FAILURE;
+    GetExitCodeProcess(process.hProcess, &exit_code);
+    CloseHandle(process.hThread);
+    CloseHandle(process.hProcess);
+    return exit_code == 0;
+}
+BOOL CALLBACK close_process_window(HWND window, LPARAM process_id) {
+    DWORD owner;
+    GetWindowThreadProcessId(window, &owner);
+    if(owner == (DWORD) process_id) {
+        PostMessage(window, WM_CLOSE, 0, 0);
+    }
+    return TRUE;
+}
+// with a stop timeout, asks the executable to close (WM_CLOSE for windows, ctrl+break for consoles)
+// and only kills it if it is still running once the timeout passes. whatever it started is killed with job
+void stop(PROCESS_INFORMATION *process, double stop_timeout, HANDLE job) {
+    if(WaitForSingleObject(process->hProcess, 0) == WAIT_TIMEOUT) {
+        if(stop_timeout > 0) {
+            EnumWindows(close_process_window, (LPARAM) process->dwProcessId);
+            GenerateConsoleCtrlEvent(CTRL_BREAK_EVENT, process->dwProcessId);
+        }
+        if(stop_timeout <= 0 || WaitForSingleObject(process->hProcess, (DWORD) (stop_timeout * 1000)) == WAIT_TIMEOUT) {
+            TerminateProcess(process->hProcess, EXIT_FAILURE);
+        }
+        WaitForSingleObject(process->hProcess, INFINITE); // the executable stays locked until it is gone
+    }
+    if(job) {
+        TerminateJobObject(job, EXIT_FAILURE);
+    }
+    CloseHandle(process->hThread);
+    CloseHandle(process->hProcess);
+}
+// blocks until something outside the ignored paths changes, then until the burst settles.
+// with built_at, first goes through what was queued since that build started. the build's own writes
+// overflow the buffer easily, so an overflow there only counts if a source file is newer than the build.
+// returns 0 if the tree can not be watched
+int wait_for_changes(HANDLE directory, nx_json const *ignore, LARGE_INTEGER *first_change, time_t built_at) {
+    DWORD changes[16384]; // ReadDirectoryChangesW needs a DWORD aligned buffer
+    OVERLAPPED overlapped = {0};
+    overlapped.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+    DWORD filter = FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_DIR_NAME | FILE_NOTIFY_CHANGE_LAST_WRITE | FILE_NOTIFY_CHANGE_SIZE;
+    DWORD timeout = built_at ? 0 : WATCH_STAMP_MS;
+    DWORD bytes;
+    int draining = built_at != 0;
+    int changed = 0;
+
+    for(;;) {
+        ResetEvent(overlapped.hEvent);
+        if(!ReadDirectoryChangesW(directory, changes, sizeof(changes), TRUE, filter, NULL, &overlapped, NULL)) {
+            fprintf(stderr, "failed to watch repository (error %lu)\n", GetLastError());
+            changed = 0;
+            break;
+        }
+        if(WaitForSingleObject(overlapped.hEvent, timeout) == WAIT_TIMEOUT) {
+            CancelIo(directory);
+            GetOverlappedResult(directory, &overlapped, &bytes, TRUE);
+            if(changed) break; // burst is over
+            draining = 0; // queue is empty, wait for new changes
+            timeout = WATCH_STAMP_MS;
+            touch_worktree_stamp(); // a long watch session still counts as using the worktree
+            continue;
+        }
+        if(!GetOverlappedResult(directory, &overlapped, &bytes, FALSE)) {
+            fprintf(stderr, "failed to watch repository (error %lu)\n", GetLastError());
+            changed = 0;
+            break;
+        }
+
+        int relevant = 0;
+        if(bytes == 0) { // notification buffer overflowed, anything could have changed
+            relevant = !draining || newest_source_time("", ignore) >= built_at;
+        }
+        FILE_NOTIFY_INFORMATION *change = bytes ? (FILE_NOTIFY_INFORMATION *) changes : NULL;
+        while(change) {
+            char name[1024];
+            int length = WideCharToMultiByte(CP_UTF8, 0, change->FileName, change->FileNameLength / sizeof(WCHAR), name, sizeof(name) - 1, NULL, NULL);
+            name[length] = '\0';
+            relevant = relevant || !is_ignored(name, ignore);
+            change = change->NextEntryOffset ? (FILE_NOTIFY_INFORMATION *) ((char *) change + change->NextEntryOffset) : NULL;
+        }
+        if(relevant) {
+            if(!changed) QueryPerformanceCounter(first_change);
+            changed = 1;
+            timeout = WATCH_DEBOUNCE_MS;
+        }
+    }
+    CloseHandle(overlapped.hEvent);
+    return changed;
+}
+// keeps the executable running and rebuilds and restarts it whenever the repository changes.
+// only returns if watching fails
+int watch(const char *executable, nx_json const *custom_commands, nx_json const *ignore, double stop_timeout) {
+    HANDLE directory = CreateFile(".", FILE_LIST_DIRECTORY, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, 
+        NULL, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED, NULL);
+    if(directory == INVALID_HANDLE_VALUE) {
+        fprintf(stderr, "failed to open repository for watching (error %lu)\n", GetLastError());
+        return 0;
+    }
+    DWORD flags = executable_priority | (stop_timeout > 0 ? CREATE_NEW_PROCESS_GROUP : 0); // lets ctrl+break reach only the executable
+    // holds the executable's process tree, so a restart doesn't leave its children behind,
+    // and takes it down with the launcher when watching is closed or killed
+    HANDLE job = executable_job ? executable_job : CreateJobObject(NULL, NULL);
+    if(job) {
+        JOBOBJECT_EXTENDED_LIMIT_INFORMATION limits = {0};
+        QueryInformationJobObject(job, JobObjectExtendedLimitInformation, &limits, sizeof(limits), NULL); // keeps the affinity
+        limits.BasicLimitInformation.LimitFlags |= JOB_OBJECT_LIMIT_KILL_ON_JOB_CLOSE;
+        if(!SetInformationJobObject(job, JobObjectExtendedLimitInformation, &limits, sizeof(limits))) {
+            fprintf(stderr, "failed to tie the executable to the launcher (error %lu)\n", GetLastError());
+        }
+    }
+    PROCESS_INFORMATION process;
+    int running = spawn(executable, &process, flags, job);
+    LARGE_INTEGER first_change;
+    time_t built_at = 0;
+
+    printf("watching for changes...\n");
+    while(wait_for_changes(directory, ignore, &first_change, built_at)) {
+        printf("change detected, rebuilding...\n");
+        if(running) stop(&process, stop_timeout, job); // windows won't let the linker replace a running executable
+        built_at = time(NULL);
+        int ok = custom_commands ? run_custom_commands(custom_commands) : build_wcmake();
+        running = ok && spawn(executable, &process, flags, job);
+        if(running) {
+            printf("change to running: %.1f ms\n", elapsed_ms(first_change));
+        } else {
+            printf("build failed, waiting for the next change...\n");
+        }
+    }
+    if(running) stop(&process, stop_timeout, job);
+    CloseHandle(directory);
+    return 0;
 }
 
 int main(int argc, char **argv) {
-    char const *json_file;
-    if(argc == 1) {
-        json_file = "../launch.json";
-    } else {
-        json_file = argv[1];
+    LARGE_INTEGER start;
+    QueryPerformanceCounter(&start);
+
+    char const *json_file = "../launch.json";
+    int watch_mode = 0;
+    for(int i = 1; i < argc; ++i) {
+        if(strcmp(argv[i], "--watch") == 0) {
+            watch_mode = 1;
+        } else {
+            json_file = argv[i];
+        }
     }
 
     mkdir("launcher");
     chdir("launcher");
+    getcwd(launcher_dir, sizeof(launcher_dir));
 
     if(!exists(json_file)) {
         perror("launch file not found!\n");
@@ -188,6 +785,8 @@ int main(int argc, char **argv) {
     }
 
     char *buffer = read_file_as_null_terminated_string(json_file);
+    struct launcher_state saved, current = {0};
+    current.config = hash_string(HASH_SEED, buffer); // before parsing, nxjson edits the buffer in place
     nx_json const *json = nx_json_parse_utf8(buffer);
 
     if(!json) {
@@ -202,6 +801,11 @@ int main(int argc, char **argv) {
     nx_json const* msys_dir_in     = nx_json_get(json, "msys path");
     nx_json const* packages        = nx_json_get(json, "additional packages");
     nx_json const* custom_commands = nx_json_get(json, "custom build commands");
+    nx_json const* interval_in     = nx_json_get(json, "update interval");
+    nx_json const* stop_timeout_in = nx_json_get(json, "stop timeout");
+    nx_json const* watch_ignore    = nx_json_get(json, "watch ignore");
+    nx_json const* store_path_in   = nx_json_get(json, "store path");
+    nx_json const* prune_in        = nx_json_get(json, "prune worktrees");
 
     if(!repo_in) {
         perror("repo is requiered!\n");
@@ -222,14 +826,67 @@ int main(int argc, char **argv) {
     char const* repo       = repo_in       -> text_value;
     char const* branch     = branch_in     -> text_value;
     char const* executable = executable_in -> text_value;
-
-    printf("repo: %s on branch %s\n", repo, branch);
+    double update_interval = interval_in ? interval_in->num.dbl_value : 0; // minutes
+    double stop_timeout = stop_timeout_in ? stop_timeout_in->num.dbl_value : 0; // seconds
 
     if(msys_dir_in) {
         snprintf(msys_dir, sizeof(msys_dir), msys_dir_in->text_value); 
     } else {
         snprintf(msys_dir, sizeof(msys_dir), "C:\\msys64"); 
     }
+    char msys_path[1024];
+    snprintf(msys_path, sizeof(msys_path), "%s\\mingw64\\bin;%s\\usr\\bin;%s;", msys_dir, msys_dir, msys_dir);
+    current.packages = hash_packages(packages, custom_commands);
+    build_job = create_job(json, "build");
+    executable_job = create_job(json, "executable");
+    build_priority = read_priority_class(json, "build");
+    executable_priority = read_priority_class(json, "executable");
+
+    char store_root[1024];
+    if(store_path_in) {
+        // relative paths are taken from the launcher directory, git would resolve them against the bare clone
+        if(_fullpath(store_root, store_path_in->text_value, sizeof(store_root)) == NULL) {
+            fprintf(stderr, "invalid store path %s\n", store_path_in->text_value);
+            system("pause");
+            return EXIT_FAILURE;
+        }
+    } else if(getenv("LOCALAPPDATA")) {
+        snprintf(store_root, sizeof(store_root), "%s\\launcher", getenv("LOCALAPPDATA"));
+    } else {
+        snprintf(store_root, sizeof(store_root), "%s\\store", launcher_dir);
+    }
+    int legacy_clone = exists("repository");
+    if(legacy_clone) {
+        snprintf(repository_dir, sizeof(repository_dir), "%s\\repository", launcher_dir);
+    } else {
+        locate_repository(store_root, repo, branch);
+    }
+
+    int has_state = load_state(&saved);
+    int packages_installed = has_state && saved.packages == current.packages;
+
+    // nothing changed since the last full run and upstream was checked recently:
+    // launch right away without spawning git, cmake or pacman
+    if(update_interval > 0 && has_state && 
+        time(NULL) - saved.checked < update_interval * 60 &&
+        saved.config == current.config && saved.packages == current.packages &&
+        compute_state(&current, executable, watch_ignore) && strcmp(saved.ref, current.ref) == 0 &&
+        saved.configure == current.configure && saved.build == current.build) 
+    {
+        printf("%s is up to date (%.1f ms)\n", branch, elapsed_ms(start));
+        add_to_path(msys_path);
+        touch_worktree_stamp(); // only the full path goes through setup_repository
+        chdir(repository_dir);
+        int ok = watch_mode ? watch(executable, custom_commands, watch_ignore, stop_timeout) : launch(executable);
+        nx_json_free(json);
+        free(buffer);
+        system("pause");
+        return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    invalidate_state();
+
+    printf("repo: %s on branch %s\n", repo, branch);
+    printf("checkout: %s\n", repository_dir);
     
     if(!exists(msys_dir)) {
         printf("downloading msys installer...\n");
@@ -239,12 +896,13 @@ int main(int argc, char **argv) {
         snprintf(command, sizeof(command), ".\\msys2-x86_64-latest.exe in --confirm-command --accept-messages --root %s", msys_dir);
         system(command);
     }
-    char msys_path[1024];
-    snprintf(msys_path, sizeof(msys_path), "%s\\mingw64\\bin;%s\\usr\\bin;%s;", msys_dir, msys_dir, msys_dir);
     add_to_path(msys_path);
 
-    if(!exists("repository/build")) {
-        for(int i = 0; i < packages->children.length; ++i) {
+    // packages only need another look when the list changed since the last successful run
+    char build_dir[1024];
+    snprintf(build_dir, sizeof(build_dir), "%s\\build", repository_dir);
+    if(!exists(build_dir) || !packages_installed) {
+        for(int i = 0; packages && i < packages->children.length; ++i) {
             install_package(nx_json_item(packages, i)->text_value);
         }
         install_package("git");
@@ -253,20 +911,27 @@ int main(int argc, char **argv) {
             install_package("mingw-w64-x86_64-cmake");
             install_package("mingw-w64-x86_64-ninja");
         }
+        current.packages = hash_packages(packages, custom_commands); // installing changed the database
     }
 
-    int ok = setup_repository(repo, branch);
+    int ok = legacy_clone ? setup_clone(repo, branch) : setup_repository(repo, branch);
+    if(!legacy_clone && prune_in) {
+        prune_worktrees(prune_in->num.dbl_value);
+    }
+    current.checked = time(NULL);
     if(!custom_commands) {
         ok = ok && setup_wcmake();
         ok = ok && build_wcmake();
     }
     else {
-        for(int i = 0; i < custom_commands->children.length; ++i) {
-            msys(nx_json_item(custom_commands, i)->text_value);
-        }
+        ok = ok && run_custom_commands(custom_commands);
+    }
+
+    if(ok && compute_state(&current, executable, watch_ignore)) {
+        save_state(&current);
     }
     
-    ok = ok && launch(executable);
+    ok = ok && (watch_mode ? watch(executable, custom_commands, watch_ignore, stop_timeout) : launch(executable));
     nx_json_free(json);
     free(buffer);
     system("pause");